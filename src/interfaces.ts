@@ -33,6 +33,36 @@ export interface IWinSize {
 export interface PtyFileDescriptors {
     read: number;
     write: number;
+    /**
+     * id of the poll thread, -1 if not started
+     */
+    id: number;
+}
+
+
+/**
+ * counters of the master --> stdout channel
+ */
+export interface IoStats {
+    /**
+     * bytes written to the stdout pipe
+     */
+    forwarded: number;
+
+    /**
+     * bytes discarded by the rate governor
+     */
+    discarded: number;
+
+    /**
+     * coalesced frames sent by the rate governor in degraded mode
+     */
+    frames: number;
+
+    /**
+     * whether the rate governor is currently in degraded mode
+     */
+    degraded: boolean;
 }
 
 
@@ -46,7 +76,9 @@ export interface INative {
     ptsname(fd: number): string;
     get_size(fd: number): IWinSize;
     set_size(fd: number, cols: number, rows: number, xpixel: number, ypixel: number): IWinSize;
-    get_io_channels(fd: number): PtyFileDescriptors;
+    get_io_channels(fd: number, rate_limit?: number): PtyFileDescriptors;
+    get_io_stats(id: number): IoStats | null;
+    release_io_stats(id: number): void;
     load_driver(fd: number): void;
     FD_FLAGS: FdFlags;
 }
@@ -91,6 +123,14 @@ export interface PtyOptions extends RawPtyOptions {
      * (dont use with a child process)
      */
     init_slave?: boolean;
+
+    /**
+     * output rate limit of stdout in bytes/s - defaults to 0 (unlimited)
+     * Above the limit master gets still drained, but only coalesced frames
+     * of the latest data are forwarded, the remaining data is discarded.
+     * Bursts up to one second worth of the limit pass unthrottled.
+     */
+    rate_limit?: number;
 }
 
 
@@ -205,6 +245,12 @@ export interface IPty extends IRawPty {
      * close slave stream
      */
     close_slave_stream(): void;
+
+    /**
+     * get counters of the master streams, kept after the child exited
+     * until the master streams get closed (null then)
+     */
+    get_io_stats(): IoStats | null;
 }
 
 
@@ -239,6 +285,11 @@ export interface PtySpawnOptions extends cp.SpawnOptions {
      * auto_close pty on exit
      */
     auto_close?: boolean;
+
+    /**
+     * output rate limit of stdout in bytes/s (see PtyOptions)
+     */
+    rate_limit?: number;
 }
 
 
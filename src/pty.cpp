@@ -5,13 +5,20 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <string.h>
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <map>
 
 // some global settings
 #define POLL_FIFOLENGTH 4       // poll fifo buffer length
 #define POLL_BUFSIZE    16384   // poll fifo entry size
 #define POLL_TIMEOUT    100     // poll timeout in msec
+#define GOVERNOR_FRAME  50      // degraded mode frame interval in msec
 
 
 // typical OS defines: https://sourceforge.net/p/predef/wiki/OperatingSystems/
@@ -175,6 +182,10 @@ NAN_METHOD(js_pty_set_size) {
  *  and can be accessed with `net.Socket` from Javascript.
  *  A final hangup on the slave side of the pty device will not be propagated
  *  to the right side until all pending data got consumed.
+ *
+ *  Optionally the master --> stdout direction can be throttled by a rate
+ *  governor (see `Governor` below) to protect the event loop from
+ *  runaway children.
  */
 
 typedef struct {
@@ -241,20 +252,163 @@ private:
     FifoEntry *m_entries;
 };
 
+/**
+ * Output rate governor for master --> writer
+ *
+ * The governor runs a token bucket over all bytes read from master,
+ * refilled with `rate` bytes/s and holding at most one second of budget.
+ * Reads into lfifo are limited to the remaining budget (see `budget()`),
+ * so only the bucket content can pass unthrottled as a burst.
+ * Once the bucket runs dry the governor switches to degraded mode:
+ * master is still drained to not block the child, but the data gets
+ * coalesced into a frame buffer that only keeps the latest bytes
+ * (cut at a line start if possible). The frame is forwarded once
+ * every GOVERNOR_FRAME msec, anything pushed out of it is discarded.
+ * The frame size is the budget of one frame interval (max. POLL_BUFSIZE),
+ * thus the forwarded data stays within `rate` in degraded mode.
+ * Degraded mode is left when the bucket refilled to half of its capacity,
+ * a still pending frame is forwarded right away then.
+ *
+ * NOTE: Discarding may cut through escape sequences or multibyte
+ * characters, a consumer should expect garbled output in degraded mode.
+ */
+class Governor {
+public:
+    Governor(double rate) :
+      m_rate(rate),
+      m_tokens(rate),
+      m_degraded(false),
+      m_frame_length(0),
+      // clamp as double, the int conversion is undefined for huge rates
+      m_frame_size(std::min(std::max(rate * GOVERNOR_FRAME / 1000, 1.0), (double) POLL_BUFSIZE)),
+      m_last_refill(std::chrono::steady_clock::now()),
+      m_last_frame(m_last_refill) {
+        m_frame = new char[POLL_BUFSIZE * 2]();
+    }
+    ~Governor() {
+        delete[] m_frame;
+    }
+    bool degraded() {
+        return m_degraded;
+    }
+    // master data has to go through the frame buffer
+    bool draining() {
+        return m_degraded;
+    }
+    bool framePending() {
+        return (bool) m_frame_length;
+    }
+    void refill() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        m_tokens += std::chrono::duration<double>(now - m_last_refill).count() * m_rate;
+        if (m_tokens > m_rate)
+            m_tokens = m_rate;
+        m_last_refill = now;
+        if (m_degraded && m_tokens >= m_rate / 2)
+            m_degraded = false;
+    }
+    // max. bytes to read into lfifo without exceeding the budget
+    int budget() {
+        return (int) std::min(std::max(m_tokens, 1.0), (double) POLL_BUFSIZE);
+    }
+    void account(int bytes) {
+        refill();
+        m_tokens -= bytes;
+        if (m_tokens < 1) {
+            m_tokens = std::max(m_tokens, 0.0);
+            m_degraded = true;
+        }
+    }
+    // msec until the next frame is due
+    int frameTimeout() {
+        int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - m_last_frame).count();
+        return (elapsed >= GOVERNOR_FRAME) ? 0 : GOVERNOR_FRAME - elapsed;
+    }
+    // read target for master, has room for POLL_BUFSIZE bytes
+    char* frameTail() {
+        return m_frame + m_frame_length;
+    }
+    // commit bytes read into frameTail, returns number of discarded bytes
+    int commitFrame(int bytes) {
+        m_frame_length += bytes;
+        if (m_frame_length <= m_frame_size)
+            return 0;
+        int cut = m_frame_length - m_frame_size;
+        char *nl = static_cast<char *>(memchr(m_frame + cut, '\n', m_frame_size - 1));
+        if (nl)
+            cut = nl - m_frame + 1;
+        memmove(m_frame, m_frame + cut, m_frame_length - cut);
+        m_frame_length -= cut;
+        return cut;
+    }
+    // copy frame to dest (min. POLL_BUFSIZE), returns frame length
+    int popFrame(char *dest) {
+        int length = m_frame_length;
+        memcpy(dest, m_frame, length);
+        m_frame_length = 0;
+        m_last_frame = std::chrono::steady_clock::now();
+        return length;
+    }
+private:
+    double m_rate;
+    double m_tokens;
+    bool m_degraded;
+    int m_frame_length;
+    int m_frame_size;
+    char *m_frame;
+    std::chrono::steady_clock::time_point m_last_refill;
+    std::chrono::steady_clock::time_point m_last_frame;
+};
+
+/**
+ * Counters for master --> writer
+ *
+ * Written by the poll thread and read with `get_io_stats`.
+ * The counters outlive the poll thread until released with
+ * `release_io_stats`, thus they can still be read after the child exited.
+ */
+struct PollStats {
+    std::atomic<uint64_t> forwarded;
+    std::atomic<uint64_t> discarded;
+    std::atomic<uint64_t> frames;
+    std::atomic<bool> degraded;
+    bool finished;      // poll thread has ended
+    bool released;      // released from JS
+};
+
 struct Poll {
     int master;
     int read;
     int write;
     Fifo *lfifo;
     Fifo *rfifo;
+    Governor *governor;     // nullptr if not rate limited
     uv_async_t async;
     uv_thread_t tid;
+    int id;
+    PollStats *stats;       // not owned, see PollStats
     ~Poll() {
         delete lfifo;
         delete rfifo;
+        delete governor;
     }
 };
 
+// unreleased counters by poll thread id, only accessed from main thread
+static std::map<int, PollStats *> poll_stats;
+static int poller_id = 0;
+
+// whether master can be read into lfifo or the governor frame
+inline bool master_readable(Governor *governor, Fifo *lfifo) {
+    if (governor && governor->draining())
+        return true;
+    // pending frame after degraded mode: stop reading until it got forwarded
+    if (governor && governor->framePending())
+        return false;
+    return !lfifo->full();
+}
+
 #include <ctime>
 inline void poll_thread(void *data) {
     Poll *poller = static_cast<Poll *>(data);
@@ -265,8 +419,11 @@ inline void poll_thread(void *data) {
     int writer = poller->write;     // write pipe
     Fifo *lfifo = poller->lfifo;    // master --> writer
     Fifo *rfifo = poller->rfifo;    // master <-- reader
+    Governor *governor = poller->governor;  // master --> writer rate limit
 
     FifoEntry *entry;
+    char *target;
+    int r_size;
     int r_bytes, w_bytes;
     bool read_master_block = false;
     bool read_reader_block = false;
@@ -287,6 +444,8 @@ inline void poll_thread(void *data) {
         {reader, POLLIN, 0}
     };
     int result;
+    bool read_master_ok;
+    int timeout;
     //int counter = 0;
     //std::clock_t start;
     //start = std::clock();
@@ -295,13 +454,29 @@ inline void poll_thread(void *data) {
     // poll loop
     for (;;) {
         //counter++;
+        // rate governor: push coalesced frame to lfifo if due
+        // (immediately if master died or degraded mode has ended)
+        if (governor) {
+            governor->refill();
+            if (governor->framePending()
+                    && (read_master_exit || !governor->degraded() || !governor->frameTimeout())
+                    && (entry = lfifo->getPushEntry())) {
+                entry->length = governor->popFrame(entry->data);
+                entry->written = 0;
+                lfifo->commitPush();
+                poller->stats->frames++;
+            }
+            poller->stats->degraded = governor->degraded();
+        }
+        read_master_ok = master_readable(governor, lfifo);
+
         // exit: no more data can be written
         // NOTE: read_master_exit also covers write_master_exit
         if (write_writer_exit && read_master_exit)
             break;
 
         // exit: all slave hung up, master and fifo is drained
-        if (read_master_exit && lfifo->empty())
+        if (read_master_exit && lfifo->empty() && !(governor && governor->framePending()))
             break;
 
         // no js consumer anymore and rfifo empty, should we close master here?
@@ -319,7 +494,7 @@ inline void poll_thread(void *data) {
         else
             // need to remove master from fds under linux if already hung up
             // and pending data cant be read (fifo full) to avoid busy polling with POLLHUP
-            fds[0].fd = (lfifo->full() && write_master_exit) ? -1 : master;
+            fds[0].fd = (!read_master_ok && write_master_exit) ? -1 : master;
         if (write_writer_exit)  // writer has died
             fds[1].fd = -1;
         if (read_reader_exit)   // reader has died
@@ -327,15 +502,22 @@ inline void poll_thread(void *data) {
 
         // poll query
         // POLLOUT only if data needs to be written
-        // POLLIN only if data can be stored
+        // POLLIN only if data can be stored (always while governor drains master)
         fds[0].events = (rfifo->empty())
-            ? (lfifo->full() ? 0 : POLLIN)
-            : POLLOUT | (lfifo->full() ? 0 : POLLIN);
+            ? (read_master_ok ? POLLIN : 0)
+            : POLLOUT | (read_master_ok ? POLLIN : 0);
         fds[1].events = (lfifo->empty()) ? 0 : POLLOUT;
         fds[2].events = (rfifo->full()) ? 0 : POLLIN;
 
+        // wake up in time for a pending governor frame
+        // (not with lfifo full, the writer's POLLOUT wakes us up then)
+        timeout = POLL_TIMEOUT;
+        if (governor && governor->framePending() && !lfifo->full()
+                && governor->frameTimeout() < timeout)
+            timeout = governor->frameTimeout();
+
         // finally poll
-        TEMP_FAILURE_RETRY(result = poll(fds, 3, POLL_TIMEOUT));
+        TEMP_FAILURE_RETRY(result = poll(fds, 3, timeout));
         if (result == -1)
             break;  // something unexpected happened, exit poll thread
         if (!result)
@@ -390,10 +572,21 @@ inline void poll_thread(void *data) {
         for (;;) {
 
             // read master
+            // governor draining: read into frame buffer regardless of lfifo state
             if (!read_master_exit && !read_master_block) {
-                entry = lfifo->getPushEntry();
-                if (entry) {
-                    TEMP_FAILURE_RETRY(r_bytes = read(master, entry->data, POLL_BUFSIZE));
+                entry = nullptr;
+                target = nullptr;
+                r_size = POLL_BUFSIZE;
+                if (governor && governor->draining()) {
+                    target = governor->frameTail();
+                } else if (master_readable(governor, lfifo)) {
+                    entry = lfifo->getPushEntry();
+                    target = entry->data;
+                    if (governor)
+                        r_size = governor->budget();
+                }
+                if (target) {
+                    TEMP_FAILURE_RETRY(r_bytes = read(master, target, r_size));
                     if (r_bytes == -1) {
                         if (errno == EAGAIN) {
                             read_master_block = true;
@@ -405,11 +598,15 @@ inline void poll_thread(void *data) {
                         if (!r_bytes) {
                             read_master_exit = true;
                             read_master_block = true;
-                        } else {
+                        } else if (entry) {
                             entry->length = r_bytes;
                             entry->written = 0;
                             lfifo->commitPush();
+                        } else {
+                            poller->stats->discarded += governor->commitFrame(r_bytes);
                         }
+                        if (r_bytes && governor)
+                            governor->account(r_bytes);
                     }
                 }
             }
@@ -428,10 +625,12 @@ inline void poll_thread(void *data) {
                         }
                     } else if (w_bytes == entry->length) {
                         lfifo->commitPop();
+                        poller->stats->forwarded += w_bytes;
                     } else {
                         entry->written += w_bytes;
                         entry->length -= w_bytes;
                         write_writer_block = true;
+                        poller->stats->forwarded += w_bytes;
                     }
                 }
             }
@@ -487,8 +686,8 @@ inline void poll_thread(void *data) {
             if (!repoll--)
                 break;
 
-            // master can be read and written to lfifo
-            if (!read_master_block && !lfifo->full())
+            // master can be read and written to lfifo or governor frame
+            if (!read_master_block && master_readable(governor, lfifo))
                 continue;
             // lfifo can write to writer
             if (!lfifo->empty() && !write_writer_block)
@@ -518,6 +717,10 @@ inline void close_poll_thread(uv_handle_t *handle) {
     TEMP_FAILURE_RETRY(close(poller->write));
     TEMP_FAILURE_RETRY(close(poller->read));
     uv_thread_join(&poller->tid);
+    poller->stats->finished = true;
+    poller->stats->degraded = false;
+    if (poller->stats->released)
+        delete poller->stats;
     delete poller;
 }
 
@@ -526,10 +729,17 @@ inline void after_poll_thread(uv_async_t *async) {
 }
 
 NAN_METHOD(get_io_channels) {
-    if (info.Length() != 1 || !info[0]->IsNumber())
-        return Nan::ThrowError("usage: pty.get_io_channels(fd)");
+    if (info.Length() < 1 || info.Length() > 2
+            || !info[0]->IsNumber()
+            || (info.Length() == 2 && !info[1]->IsNumber()))
+        return Nan::ThrowError("usage: pty.get_io_channels(fd[, rate_limit])");
 
     Poll *poller = nullptr;
+    int id = -1;
+    // output rate limit in bytes/s, 0 disables the governor
+    double rate = (info.Length() == 2) ? info[1]->NumberValue(Nan::GetCurrentContext()).ToChecked() : 0;
+    if (!std::isfinite(rate) || rate < 0)
+        return Nan::ThrowError("usage: pty.get_io_channels(fd[, rate_limit])");
 
     // create pipes for reading and writing
     int pipes1[2] = {-1, -1};
@@ -559,7 +769,11 @@ NAN_METHOD(get_io_channels) {
     poller->write = pipes1[1];
     poller->lfifo = new Fifo(POLL_FIFOLENGTH, POLL_BUFSIZE);   // master --> writer
     poller->rfifo = new Fifo(POLL_FIFOLENGTH, POLL_BUFSIZE);   // master <-- reader
+    poller->governor = (rate > 0) ? new Governor(rate) : nullptr;
     poller->async.data = poller;
+    poller->id = id = poller_id++;
+    poller->stats = new PollStats();
+    poll_stats[id] = poller->stats;
 
     uv_async_init(uv_default_loop(), &poller->async, after_poll_thread);
     uv_thread_create(&poller->tid, poll_thread, static_cast<void *>(poller));
@@ -568,9 +782,44 @@ NAN_METHOD(get_io_channels) {
     Local<Object> obj = Nan::New<Object>();
     SET(obj, "read", Nan::New<Number>(pipes1[0]));
     SET(obj, "write", Nan::New<Number>(pipes2[1]));
+    SET(obj, "id", Nan::New<Number>(id));
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(get_io_stats) {
+    if (info.Length() != 1 || !info[0]->IsNumber())
+        return Nan::ThrowError("usage: pty.get_io_stats(id)");
+    std::map<int, PollStats *>::iterator it = poll_stats.find(
+        info[0]->Int32Value(Nan::GetCurrentContext()).ToChecked());
+    // unknown or already released
+    if (it == poll_stats.end())
+        return info.GetReturnValue().SetNull();
+    PollStats *stats = it->second;
+    Local<Object> obj = Nan::New<Object>();
+    SET(obj, "forwarded", Nan::New<Number>(static_cast<double>(stats->forwarded)));
+    SET(obj, "discarded", Nan::New<Number>(static_cast<double>(stats->discarded)));
+    SET(obj, "frames", Nan::New<Number>(static_cast<double>(stats->frames)));
+    SET(obj, "degraded", Nan::New<Boolean>(stats->degraded));
     info.GetReturnValue().Set(obj);
 }
 
+NAN_METHOD(release_io_stats) {
+    if (info.Length() != 1 || !info[0]->IsNumber())
+        return Nan::ThrowError("usage: pty.release_io_stats(id)");
+    std::map<int, PollStats *>::iterator it = poll_stats.find(
+        info[0]->Int32Value(Nan::GetCurrentContext()).ToChecked());
+    if (it != poll_stats.end()) {
+        PollStats *stats = it->second;
+        poll_stats.erase(it);
+        // still in use by a running poll thread, deleted in close_poll_thread
+        if (stats->finished)
+            delete stats;
+        else
+            stats->released = true;
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
 NAN_METHOD(load_driver) {
 #ifdef SOLARIS
     if (info.Length() != 1 || !info[0]->IsNumber())
@@ -610,6 +859,8 @@ NAN_MODULE_INIT(init) {
     SET(target, "get_size", Nan::GetFunction(Nan::New<FunctionTemplate>(js_pty_get_size)).ToLocalChecked());
     SET(target, "set_size", Nan::GetFunction(Nan::New<FunctionTemplate>(js_pty_set_size)).ToLocalChecked());
     SET(target, "get_io_channels", Nan::GetFunction(Nan::New<FunctionTemplate>(get_io_channels)).ToLocalChecked());
+    SET(target, "get_io_stats", Nan::GetFunction(Nan::New<FunctionTemplate>(get_io_stats)).ToLocalChecked());
+    SET(target, "release_io_stats", Nan::GetFunction(Nan::New<FunctionTemplate>(release_io_stats)).ToLocalChecked());
     SET(target, "load_driver", Nan::GetFunction(Nan::New<FunctionTemplate>(load_driver)).ToLocalChecked());
 
     // needed fd flags
@@ -7,6 +7,17 @@ import * as pty from './pty';
 import * as Interfaces from './interfaces';
 import {Termios} from 'node-termios';
 
+// native poll settings, see src/pty.cpp
+const POLL_TIMEOUT: number = 100;
+const GOVERNOR_FRAME: number = 50;
+
+// call `callback` once `condition` returns true, checked every `interval` msec
+function wait_for(condition: () => boolean, interval: number, callback: () => void): void {
+    if (condition())
+        return callback();
+    setTimeout(() => { wait_for(condition, interval, callback); }, interval);
+}
+
 describe('native functions', () => {
     it('ptname/grantpt/unlockpt + open slave', () => {
         let master: number = -1;
@@ -241,6 +252,69 @@ describe('class Pty', () => {
             done();
         });
     });
+    it('io stats without rate_limit', (done) => {
+        let jsPty: pty.Pty = new pty.Pty({termios: new Termios(0)});
+        let received: string = '';
+        jsPty.stdout.on('data', (data: Buffer) => {
+            received += data.toString();
+        });
+        let line: string = new Array(80).join('x') + '\n';
+        for (let i = 0; i < 100; ++i)
+            fs.writeSync(jsPty.slave_fd, line);
+        fs.writeSync(jsPty.slave_fd, '__sentinel__');
+        wait_for(() => received.slice(-12) === '__sentinel__', 10, () => {
+            assert.deepStrictEqual(jsPty.get_io_stats(),
+                {forwarded: received.length, discarded: 0, frames: 0, degraded: false});
+            jsPty.close();
+            done();
+        });
+    });
+    it('rate_limit should forward the latest data and discard above the limit', function(done) {
+        let rate_limit: number = 1000;
+        // degraded mode ends once half of the bucket (one second of budget) got refilled
+        let recovery: number = 1000 * (rate_limit / 2) / rate_limit;
+        this.timeout(2000 + recovery * 4);
+        let jsPty: pty.Pty = new pty.Pty({termios: new Termios(0), rate_limit: rate_limit});
+        let id: number = (jsPty as any)._fds.id;
+        let start: number = Date.now();
+        let received: string = '';
+        jsPty.stdout.on('data', (data: Buffer) => {
+            received += data.toString();
+        });
+        let line: string = new Array(80).join('x') + '\n';
+        for (let i = 0; i < 1000; ++i)
+            fs.writeSync(jsPty.slave_fd, line);
+        fs.writeSync(jsPty.slave_fd, '__sentinel__');
+        // last frame must carry the tail of the flood
+        wait_for(() => received.slice(-12) === '__sentinel__', GOVERNOR_FRAME, () => {
+            let elapsed: number = (Date.now() - start) / 1000;
+            let stats: Interfaces.IoStats = jsPty.get_io_stats();
+            assert.strictEqual(stats.forwarded, received.length);
+            assert.strictEqual(stats.discarded > 0, true);
+            assert.strictEqual(stats.frames > 0, true);
+            // initial bucket + frames within the limit + one pending frame
+            assert.strictEqual(stats.forwarded <= rate_limit * (1 + elapsed + GOVERNOR_FRAME / 1000), true);
+            wait_for(() => !jsPty.get_io_stats().degraded, POLL_TIMEOUT, () => {
+                // below the limit data passes unthrottled again,
+                // also with paused stdout and more data than a frame holds
+                let discarded: number = jsPty.get_io_stats().discarded;
+                let frame_size: number = rate_limit * GOVERNOR_FRAME / 1000;
+                let tail: string = new Array(frame_size * 4).join('y') + '__tail__';
+                jsPty.stdout.pause();
+                fs.writeSync(jsPty.slave_fd, tail);
+                setTimeout(() => {
+                    assert.strictEqual(jsPty.get_io_stats().discarded, discarded);
+                    jsPty.stdout.resume();
+                    wait_for(() => received.slice(-tail.length) === tail, 10, () => {
+                        assert.strictEqual(jsPty.get_io_stats().discarded, discarded);
+                        jsPty.close();
+                        assert.strictEqual(pty.native.get_io_stats(id), null);
+                        done();
+                    });
+                }, GOVERNOR_FRAME * 2 + POLL_TIMEOUT);
+            });
+        });
+    });
     it('close_stream should emit "close" and invalidate streams', (done) => {
         let jsPty: pty.Pty = new pty.Pty({termios: new Termios(0), init_slave: true});
         let wait_end: number = 3;
@@ -353,6 +427,58 @@ describe('spawn', () => {
         setTimeout(() => { child.stdin.write('bash -c ' + pty.STDERR_TESTER + '\r'); }, 200);
         setTimeout(() => { child.stdin.write('exit\r'); }, 500);
     });
+    it('rate_limit counters should be kept after the child exited', (done) => {
+        let child: Interfaces.IPtyProcess = pty.spawn('cat', [path.join(FIXTURES, 'random_data')],
+            {env: process.env, termios: new Termios(0), rate_limit: 10000});
+        let id: number = (child.pty as any)._fds.id;
+        let received: number = 0;
+        child.stdout.on('data', (data: Buffer) => {
+            received += data.length;
+        });
+        // poll thread has finished once stdout closes
+        child.stdout.on('close', () => {
+            let stats: Interfaces.IoStats = child.pty.get_io_stats();
+            assert.notStrictEqual(stats, null);
+            assert.strictEqual(stats.forwarded, received);
+            assert.strictEqual(stats.forwarded + stats.discarded >= 1000000, true);
+            assert.strictEqual(stats.discarded > 0, true);
+            assert.strictEqual(stats.degraded, false);
+            child.pty.close();
+            assert.strictEqual(child.pty.get_io_stats(), null);
+            assert.strictEqual(pty.native.get_io_stats(id), null);
+            done();
+        });
+    });
+    it('rate_limit should not spin with paused stdout', function(done) {
+        this.timeout(10000);
+        let child: Interfaces.IPtyProcess = pty.spawn('yes', [],
+            {env: process.env, termios: new Termios(0), rate_limit: 65536});
+        child.stdout.pause();
+        // frames stop being forwarded once the native fifo is full
+        let last_forwarded: number = -1;
+        wait_for(() => {
+            let stats: Interfaces.IoStats = child.pty.get_io_stats();
+            let stalled: boolean = stats.degraded && stats.forwarded === last_forwarded;
+            last_forwarded = stats.forwarded;
+            return stalled;
+        }, GOVERNOR_FRAME * 4, () => {
+            child.on('exit', () => {
+                // let the poll thread see the hangup, then sample cpu time
+                // while the last frame waits on the full fifo
+                setTimeout(() => {
+                    let start: NodeJS.CpuUsage = process.cpuUsage();
+                    setTimeout(() => {
+                        let usage: NodeJS.CpuUsage = process.cpuUsage(start);
+                        // a busy polling thread would burn the whole 500 msec
+                        assert.strictEqual(usage.user + usage.system < 250000, true);
+                        child.pty.close();
+                        done();
+                    }, 500);
+                }, POLL_TIMEOUT * 2);
+            });
+            child.kill('SIGKILL');
+        });
+    });
 });
 
 import { UnixTerminal } from './pty';
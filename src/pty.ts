@@ -227,22 +227,30 @@ export class RawPty implements I.IRawPty {
  *
  * Upon instantiation only the master streams are created by default.
  * If you need a slave stream set `init_slave` to true or call `init_slave_stream()`.
+ *
+ * With `rate_limit` set the native relay throttles `stdout` to the given
+ * bytes/s (bursts up to one second worth of the limit pass unthrottled).
+ * Above the limit the slave output is still consumed, but only
+ * coalesced frames of the latest data get through. Use `get_io_stats()`
+ * to see how much data was discarded.
  */
 export class Pty extends RawPty implements I.IPty {
     private _fds: I.PtyFileDescriptors;
+    private _rate_limit: number;
     public stdin: null | Socket;
     public stdout: null | Socket;
     public slave: null | tty.ReadStream;
     constructor(options?: I.PtyOptions) {
         super(options);
-        this._fds = {read: -1, write: -1};
+        this._fds = {read: -1, write: -1, id: -1};
+        this._rate_limit = (options && options.rate_limit) ? options.rate_limit : 0;
         this.init_master_streams();
         if (options && options.init_slave)
             this.init_slave_stream();
     }
     public init_master_streams(): void {
         this.close_master_streams();
-        this._fds = native.get_io_channels(this.master_fd);
+        this._fds = native.get_io_channels(this.master_fd, this._rate_limit);
         this.stdin = new Socket({fd: this._fds.write, readable: false, writable: true});
         this.stdin.on('close', (): void => {
             try { fs.closeSync(this._fds.write); } catch (e) {}
@@ -267,8 +275,11 @@ export class Pty extends RawPty implements I.IPty {
         this.stdout = null;
         try { fs.closeSync(this._fds.read); } catch (e) {}
         try { fs.closeSync(this._fds.write); } catch (e) {}
+        if (this._fds.id !== -1)
+            native.release_io_stats(this._fds.id);
         this._fds.read = -1;
         this._fds.write = -1;
+        this._fds.id = -1;
     }
     public init_slave_stream(): void {
         this.close_slave_stream();
@@ -286,6 +297,11 @@ export class Pty extends RawPty implements I.IPty {
         }
         this.slave = null;
     }
+    public get_io_stats(): I.IoStats | null {
+        if (this._fds.id === -1)
+            return null;
+        return native.get_io_stats(this._fds.id);
+    }
     public close(): void {
         this.close_slave_stream();
         this.close_master_streams();
@@ -305,6 +321,7 @@ export class Pty extends RawPty implements I.IPty {
  *  - termios   termios settings of the pty, if empty all termios flags are zeroed
  *  - size      size settings of the pty, default `{cols: 80, rows: 24}`
  *  - stderr    creates a separate pipe for stderr, default is false
+ *  - rate_limit    output rate limit of stdout in bytes/s, default is 0 (unlimited)
  *
  *  `options.detached` is always set to `true` to get a new process group
  *  with the new process as session leader.